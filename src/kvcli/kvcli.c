@@ -21,38 +21,109 @@ extern struct option long_options_cmd_delete[];
 extern struct option long_options_cmd_retrieve[];
 extern struct option long_options_cmd_select[];
 
+SPDK_TRACE_REGISTER_FN(kvcli_trace, "kvcli", KVCLI_TRACE_GROUP) {
+    struct spdk_trace_tpoint_opts opts[] = {
+        {"KVCLI_KV_SUBMIT",
+         TRACE_KVCLI_KV_SUBMIT,
+         OWNER_NONE,
+         KVCLI_TRACE_OBJECT_IO,
+         1,
+         {
+             {"opc", SPDK_TRACE_ARG_TYPE_INT, 8},
+             {"key_len", SPDK_TRACE_ARG_TYPE_INT, 8},
+             {"id", SPDK_TRACE_ARG_TYPE_INT, 8},
+         }},
+        {"KVCLI_KV_COMPLETE",
+         TRACE_KVCLI_KV_COMPLETE,
+         OWNER_NONE,
+         KVCLI_TRACE_OBJECT_IO,
+         0,
+         {
+             {"opc", SPDK_TRACE_ARG_TYPE_INT, 8},
+             {"cdw0", SPDK_TRACE_ARG_TYPE_INT, 8},
+             {"sc", SPDK_TRACE_ARG_TYPE_INT, 8},
+         }},
+    };
+
+    spdk_trace_register_object(KVCLI_TRACE_OBJECT_IO, 'k');
+    spdk_trace_register_description_ext(opts, SPDK_COUNTOF(opts));
+}
+
+// record the submission of a kv command. cb_arg is the callback argument of
+// the command and identifies it until its callback runs. id is the result id
+// of a retrieve select. the arguments are registered with size 8, so they are
+// passed as uint64_t
+static void
+kvcli_trace_submit(uint8_t opc,
+                   void *cb_arg,
+                   uint16_t key_len,
+                   uint32_t nbytes,
+                   uint32_t id) {
+    spdk_trace_record(TRACE_KVCLI_KV_SUBMIT,
+                      0,
+                      nbytes,
+                      (uint64_t)(uintptr_t)cb_arg,
+                      3,
+                      (uint64_t)opc,
+                      (uint64_t)key_len,
+                      (uint64_t)id);
+}
+
+// record the completion of a kv command, before its bdev_io is freed
+static void
+kvcli_trace_complete(struct spdk_bdev_io *bdev_io, uint8_t opc, void *cb_arg) {
+    uint32_t cdw0;
+    int sct, sc;
+
+    spdk_bdev_io_get_nvme_status(bdev_io, &cdw0, &sct, &sc);
+    spdk_trace_record(TRACE_KVCLI_KV_COMPLETE,
+                      0,
+                      0,
+                      (uint64_t)(uintptr_t)cb_arg,
+                      3,
+                      (uint64_t)opc,
+                      (uint64_t)cdw0,
+                      (uint64_t)sc);
+}
+
 static int
-write_buffer_to_file(char *buf, uint64_t nbytes, char *filename) {
+write_buffer_to_file(struct kvcli_ctx_t *ctx,
+                     char *buf,
+                     uint64_t nbytes,
+                     char *filename) {
     // SPDK_NOTICELOG("Writing buffer.\n");
 
-    FILE *fp = NULL;
-
-    fp = fopen(filename, "ab");
-    if (fp == NULL) {
-        SPDK_ERRLOG("Could not open file %s\n", filename);
-        return -1;
+    // the output file stays open until the app stops, so that it is not
+    // reopened for every chunk of a large value
+    if (ctx->output_fp == NULL) {
+        ctx->output_fp = fopen(filename, "ab");
+        if (ctx->output_fp == NULL) {
+            SPDK_ERRLOG("Could not open file %s\n", filename);
+            return -1;
+        }
     }
 
-    uint64_t bytes_written = fwrite(buf, 1, nbytes, fp);
+    uint64_t bytes_written = fwrite(buf, 1, nbytes, ctx->output_fp);
     if (bytes_written != nbytes) {
         SPDK_ERRLOG("Could not write to file %s\n", filename);
-        fclose(fp);
         return -1;
     }
 
-    fclose(fp);
     return 0;
 }
 
 static void
-create_empty_file(char *filename, int nbytes) {
-    FILE *fp = NULL;
-    fp = fopen(filename, "wb");
-    if (fp == NULL) {
+create_empty_file(struct kvcli_ctx_t *ctx, char *filename, int nbytes) {
+    // start over if the file was already opened
+    if (ctx->output_fp != NULL) {
+        fclose(ctx->output_fp);
+    }
+
+    ctx->output_fp = fopen(filename, "wb");
+    if (ctx->output_fp == NULL) {
         SPDK_ERRLOG("Could not open file %s\n", filename);
         return;
     }
-    fclose(fp);
 }
 
 static int
@@ -135,6 +206,8 @@ kvcli_reset_zone(void *arg) {
 static void
 kvcli_store_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
 
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_STORE, cb_argv);
+
     // cast callback argument to kvcli_store_cb_ctx_t
     struct kvcli_store_cb_ctx_t *cb_arg =
         (struct kvcli_store_cb_ctx_t *)cb_argv;
@@ -183,6 +256,8 @@ kvcli_send_select_cb(struct spdk_bdev_io *bdev_io,
                      bool success,
                      void *cb_argv) {
 
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_SEND_SELECT, cb_argv);
+
     // SPDK_NOTICELOG("Entered KV send select callback.\n");
 
     // cast callback argument to kvcli_send_select_cb_ctx_t
@@ -209,6 +284,24 @@ kvcli_send_select_cb(struct spdk_bdev_io *bdev_io,
         return;
     }
 
+    // small results come back in the send buffer and need no retrieve call
+    if (cb_arg->inline_result && (rc & KVCLI_SELECT_INLINE_RESULT)) {
+        uint32_t result_size =
+            MIN(rc & ~KVCLI_SELECT_INLINE_RESULT, cb_arg->ctx->buff_size);
+
+        create_empty_file(cb_arg->ctx, cb_arg->result_output_file, result_size);
+        write_buffer_to_file(cb_arg->ctx,
+                             cb_arg->ctx->buff,
+                             result_size,
+                             cb_arg->result_output_file);
+
+        spdk_put_io_channel(cb_arg->ctx->bdev_io_channel);
+        spdk_bdev_close(cb_arg->ctx->bdev_desc);
+        spdk_app_stop(0);
+        free(cb_arg);
+        return;
+    }
+
     // make context for receive select call
     struct kvcli_retrieve_select_ctx_t *ctx_retrieve_select =
         (struct kvcli_retrieve_select_ctx_t *)
@@ -231,6 +324,8 @@ static void
 kvcli_retrieve_select_cb(struct spdk_bdev_io *bdev_io,
                          bool success,
                          void *cb_argv) {
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_RETRIEVE_SELECT, cb_argv);
+
     // SPDK_NOTICELOG("Entered kv retrieve select callback.\n");
 
     // cast callback argument to kvcli_retrieve_select_cb_ctx_t
@@ -252,11 +347,14 @@ kvcli_retrieve_select_cb(struct spdk_bdev_io *bdev_io,
             // SPDK_NOTICELOG("Offset is 0.\n");
 
             // create a new file only on the first call
-            create_empty_file(cb_arg->result_output_file, total_size);
+            create_empty_file(cb_arg->ctx,
+                              cb_arg->result_output_file,
+                              total_size);
         }
 
         // write the buffer to the file
         write_buffer_to_file(
+            cb_arg->ctx,
             cb_arg->ctx->buff,
             MIN(cb_arg->ctx->buff_size, total_size - cb_arg->offset),
             cb_arg->result_output_file);
@@ -302,6 +400,8 @@ kvcli_retrieve_select_cb(struct spdk_bdev_io *bdev_io,
 
 static void
 kvcli_list_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_LIST, cb_argv);
+
     // SPDK_NOTICELOG("Entered KV list callback.\n");
 
     // cast callback argument to kvcli_list_cb_ctx_t
@@ -355,6 +455,8 @@ kvcli_list_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
 
 static void
 kvcli_exists_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_EXIST, cb_argv);
+
     // SPDK_NOTICELOG("Entered KV exists callback.\n");
 
     // cast callback argument to kvcli_exists_cb_ctx_t
@@ -385,6 +487,8 @@ kvcli_exists_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
 
 static void
 kvcli_delete_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_DELETE, cb_argv);
+
     // SPDK_NOTICELOG("Entered KV delete callback\n");
 
     // cast callback argument to kvcli_delete_cb_ctx_t
@@ -436,6 +540,8 @@ kvcli_reset_zone_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg) {
 
 static void
 kvcli_retrieve_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
+    kvcli_trace_complete(bdev_io, KVCLI_OPC_RETRIEVE, cb_argv);
+
     // SPDK_NOTICELOG("Entered KV retrieve callback.\n");
 
     // cast callback argument to kvcli_retrieve_cb_ctx_t
@@ -455,7 +561,7 @@ kvcli_retrieve_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
         // create empty file of the specified size if the offset is 0,
         // which means this is the first callback for this command
         if (cb_arg->offset == 0) {
-            create_empty_file(cb_arg->output_file, total_size);
+            create_empty_file(cb_arg->ctx, cb_arg->output_file, total_size);
         }
 
         bool make_another_call =
@@ -475,7 +581,8 @@ kvcli_retrieve_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_argv) {
         // SPDK_NOTICELOG("bytes_to_write=%d\n", bytes_to_write);
 
         // write the buffer to the file
-        write_buffer_to_file(cb_arg->ctx->buff,
+        write_buffer_to_file(cb_arg->ctx,
+                             cb_arg->ctx->buff,
                              bytes_to_write,
                              cb_arg->output_file);
 
@@ -529,19 +636,21 @@ kvcli_store(void *argv) {
     // clear the buffer
     memset(arg->ctx->buff, 0, arg->ctx->buff_size);
 
-    // open input file
-    FILE *fp = NULL;
-    fp = fopen(arg->input_file, "rb");
-    if (fp == NULL) {
-        SPDK_ERRLOG("Could not open file %s\n", arg->input_file);
-        spdk_put_io_channel(arg->ctx->bdev_io_channel);
-        spdk_bdev_close(arg->ctx->bdev_desc);
-        spdk_app_stop(-1);
-        return;
+    // open input file once and keep it open for the later chunks
+    if (arg->ctx->input_fp == NULL) {
+        arg->ctx->input_fp = fopen(arg->input_file, "rb");
+        if (arg->ctx->input_fp == NULL) {
+            SPDK_ERRLOG("Could not open file %s\n", arg->input_file);
+            spdk_put_io_channel(arg->ctx->bdev_io_channel);
+            spdk_bdev_close(arg->ctx->bdev_desc);
+            spdk_app_stop(-1);
+            return;
+        }
     }
 
-    // start reading from offset in file
-    rc = fseek(fp, arg->read_offset, SEEK_SET);
+    // start reading from offset in file. the file is already there for the
+    // next chunk, but a call retried after -ENOMEM reads the same one again
+    rc = fseek(arg->ctx->input_fp, arg->read_offset, SEEK_SET);
     if (rc) {
         spdk_put_io_channel(arg->ctx->bdev_io_channel);
         spdk_bdev_close(arg->ctx->bdev_desc);
@@ -550,7 +659,8 @@ kvcli_store(void *argv) {
     }
 
     // read from file into buffer
-    size_t bytes_read = fread(arg->ctx->buff, 1, arg->ctx->buff_size, fp);
+    size_t bytes_read =
+        fread(arg->ctx->buff, 1, arg->ctx->buff_size, arg->ctx->input_fp);
     if (bytes_read == 0) {
         spdk_put_io_channel(arg->ctx->bdev_io_channel);
         spdk_bdev_close(arg->ctx->bdev_desc);
@@ -558,8 +668,6 @@ kvcli_store(void *argv) {
         return;
     }
 
-    fclose(fp);
-
     // make callback struct
     struct kvcli_store_cb_ctx_t *cb_ctx = (struct kvcli_store_cb_ctx_t *)calloc(
         1,
@@ -587,6 +695,12 @@ kvcli_store(void *argv) {
         options |= NVME_KV_STORE_CMD_OPTION_APPEND;
     }
 
+    kvcli_trace_submit(KVCLI_OPC_STORE,
+                       cb_ctx,
+                       strlen(arg->key),
+                       bytes_read,
+                       0);
+
     rc = spdk_bdev_kv_store(arg->ctx->bdev_desc,
                             arg->ctx->bdev_io_channel,
                             arg->key,         // key name
@@ -634,6 +748,12 @@ kvcli_list(void *argv) {
     cb_ctx->ctx = arg->ctx;
     cb_ctx->skip_first = arg->skip_first;
 
+    kvcli_trace_submit(KVCLI_OPC_LIST,
+                       cb_ctx,
+                       strlen(arg->key),
+                       arg->ctx->buff_size,
+                       0);
+
     rc = spdk_bdev_kv_list(arg->ctx->bdev_desc,
                            arg->ctx->bdev_io_channel,
                            arg->key,
@@ -678,6 +798,8 @@ kvcli_exists(void *argv) {
     // keep kvcli context
     cb_ctx->ctx = arg->ctx;
 
+    kvcli_trace_submit(KVCLI_OPC_EXIST, cb_ctx, strlen(arg->key), 0, 0);
+
     rc = spdk_bdev_kv_exist(arg->ctx->bdev_desc,
                             arg->ctx->bdev_io_channel,
                             arg->key,
@@ -723,6 +845,8 @@ kvcli_delete(void *argv) {
     // keep kvcli context
     cb_ctx->ctx = arg->ctx;
 
+    kvcli_trace_submit(KVCLI_OPC_DELETE, cb_ctx, strlen(arg->key), 0, 0);
+
     rc = spdk_bdev_kv_delete(arg->ctx->bdev_desc,
                              arg->ctx->bdev_io_channel,
                              arg->key,
@@ -775,6 +899,12 @@ kvcli_retrieve(void *argv) {
 
     // SPDK_NOTICELOG("Offset: %lu\n", cb_ctx->offset);
 
+    kvcli_trace_submit(KVCLI_OPC_RETRIEVE,
+                       cb_ctx,
+                       strlen(cb_ctx->key),
+                       arg->ctx->buff_size,
+                       0);
+
     rc = spdk_bdev_kv_retrieve(arg->ctx->bdev_desc,
                                arg->ctx->bdev_io_channel,
                                cb_ctx->key,
@@ -816,6 +946,7 @@ kvcli_send_select(void *argv) {
 
     // save size of sql command
     uint64_t select_sql_size = strlen(arg->sql_cmd);
+    char *select_buff = arg->sql_cmd;
 
     // set options arg
     uint8_t options = 0;
@@ -826,6 +957,19 @@ kvcli_send_select(void *argv) {
         options |= 0x02;
     }
 
+    // with --inline, send the zero terminated query in the data buffer with
+    // some room after it, so that the device can put small results there.
+    // longer queries are sent the usual way
+    if (arg->inline_result && select_sql_size < KVCLI_SELECT_INLINE_MAX_QUERY) {
+        memcpy(arg->ctx->buff, arg->sql_cmd, select_sql_size);
+        arg->ctx->buff[select_sql_size] = '\0';
+        select_buff = arg->ctx->buff;
+        select_sql_size = MIN(select_sql_size + 1 +
+                                  KVCLI_SELECT_INLINE_RESULT_SIZE,
+                              arg->ctx->buff_size);
+        options |= KVCLI_SELECT_OPTION_INLINE;
+    }
+
     struct kvcli_send_select_cb_ctx_t *cb_ctx =
         (struct kvcli_send_select_cb_ctx_t *)
             calloc(1, sizeof(struct kvcli_send_select_cb_ctx_t));
@@ -833,12 +977,19 @@ kvcli_send_select(void *argv) {
     // keep kvcli context
     cb_ctx->ctx = arg->ctx;
     cb_ctx->result_output_file = arg->result_output_file;
+    cb_ctx->inline_result = options & KVCLI_SELECT_OPTION_INLINE;
+
+    kvcli_trace_submit(KVCLI_OPC_SEND_SELECT,
+                       cb_ctx,
+                       strlen(arg->key),
+                       select_sql_size,
+                       0);
 
     rc = spdk_bdev_kv_send_select(arg->ctx->bdev_desc,
                                   arg->ctx->bdev_io_channel,
                                   arg->key,
                                   strlen(arg->key),
-                                  arg->sql_cmd,
+                                  select_buff,
                                   select_sql_size,
                                   options,
                                   arg->input_format,
@@ -889,6 +1040,12 @@ kvcli_retrieve_select(void *argv) {
     cb_ctx->result_id = arg->result_id;
 
     // make call to get results of previous select call
+    kvcli_trace_submit(KVCLI_OPC_RETRIEVE_SELECT,
+                       cb_ctx,
+                       0,
+                       arg->ctx->buff_size,
+                       arg->result_id);
+
     rc = spdk_bdev_kv_retrieve_select(arg->ctx->bdev_desc,
                                       arg->ctx->bdev_io_channel,
                                       arg->ctx->buff,
@@ -1052,6 +1209,7 @@ kvcli_start(void *argv) {
         sel_ctx.use_csv_header_for_output = sel_args->use_csv_header_for_output;
         sel_ctx.result_output_file = sel_args->file;
         sel_ctx.key = sel_args->key;
+        sel_ctx.inline_result = sel_args->inline_result;
 
         kvcli_send_select(&sel_ctx);
     } else {
@@ -1125,7 +1283,7 @@ main(int argc, char **argv) {
         cmd_args = calloc(1, sizeof(struct cmd_select_args));
         memset(cmd_args, 0, sizeof(struct cmd_select_args));
         cmd_long_options = long_options_cmd_select;
-        num_long_options = 8;
+        num_long_options = 9;
     } else {
         SPDK_ERRLOG("Command not recognized\n");
         kvcli_usage();
@@ -1168,6 +1326,16 @@ main(int argc, char **argv) {
     spdk_dma_free(ctx.buff);
     free(cmd_args);
 
+    // close the files kept open across commands. the output file is only
+    // flushed here, so a failure means the output is incomplete
+    if (ctx.input_fp != NULL) {
+        fclose(ctx.input_fp);
+    }
+    if (ctx.output_fp != NULL && fclose(ctx.output_fp) != 0) {
+        SPDK_ERRLOG("Could not write output file\n");
+        rc = -1;
+    }
+
     // Gracefully close out all of the SPDK subsystems.
     spdk_app_fini();
     return rc;
@@ -15,10 +15,51 @@
 #include "spdk/stdinc.h"
 #include "spdk/string.h"
 #include "spdk/thread.h"
+#include "spdk/trace.h"
+#include "spdk/util.h"
 
 #ifndef KVCLI_H
 #define KVCLI_H
 
+// send select option asking the device to return the results in the send
+// buffer if they fit
+#define KVCLI_SELECT_OPTION_INLINE 0x10
+
+// longest query sent with the inline option, and the room left after it for
+// the results. the device only looks for the end of the query in the first
+// 64 KiB, and sizing the transfer to the query keeps small selects small
+#define KVCLI_SELECT_INLINE_MAX_QUERY (64 * 1024)
+#define KVCLI_SELECT_INLINE_RESULT_SIZE (64 * 1024)
+
+// set in dword0 of a send select completion when the results were returned
+// in the send buffer, the remaining bits are the size of the results
+#define KVCLI_SELECT_INLINE_RESULT 0x80000000
+
+// opcodes of the kv commands, recorded in the kvcli tracepoints
+#define KVCLI_OPC_LIST 0x06
+#define KVCLI_OPC_DELETE 0x10
+#define KVCLI_OPC_EXIST 0x14
+#define KVCLI_OPC_STORE 0x81
+#define KVCLI_OPC_RETRIEVE 0x82
+#define KVCLI_OPC_SEND_SELECT 0x83
+#define KVCLI_OPC_RETRIEVE_SELECT 0x84
+
+// trace group and object of the kvcli tracepoints. they must not collide
+// with the groups and objects in include/spdk_internal/trace_defs.h of the
+// spdk submodule, so check them when the submodule is updated, and override
+// them with -D if they do
+#ifndef KVCLI_TRACE_GROUP
+#define KVCLI_TRACE_GROUP 0x0
+#endif
+#ifndef KVCLI_TRACE_OBJECT_IO
+#define KVCLI_TRACE_OBJECT_IO 0xf0
+#endif
+
+// tracepoints recorded when kvcli submits a kv command and when its callback
+// runs, see doc/design_spdk_driver.md
+#define TRACE_KVCLI_KV_SUBMIT SPDK_TPOINT_ID(KVCLI_TRACE_GROUP, 0x0)
+#define TRACE_KVCLI_KV_COMPLETE SPDK_TPOINT_ID(KVCLI_TRACE_GROUP, 0x1)
+
 // context passed to every kvcli function
 struct kvcli_ctx_t {
     char *bdev_name;
@@ -28,6 +69,8 @@ struct kvcli_ctx_t {
     struct spdk_bdev_io_wait_entry bdev_io_wait;
     struct spdk_io_channel *bdev_io_channel;
     uint32_t buff_size;
+    FILE *input_fp;
+    FILE *output_fp;
 };
 
 // context passed to the send select function
@@ -40,6 +83,7 @@ struct kvcli_send_select_ctx_t {
     bool use_csv_header_for_output;
     char *result_output_file;
     char *key;
+    bool inline_result;
 };
 
 struct kvcli_retrieve_select_ctx_t {
@@ -92,6 +136,7 @@ struct kvcli_retrieve_select_cb_ctx_t {
 struct kvcli_send_select_cb_ctx_t {
     struct kvcli_ctx_t *ctx;
     char *result_output_file;
+    bool inline_result;
 };
 
 struct kvcli_delete_cb_ctx_t {
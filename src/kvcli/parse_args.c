@@ -56,6 +56,7 @@ struct option long_options_cmd_select[] = {
      NULL,
      CMD_SELECT_ARGS_USE_CSV_HEADER_FOR_OUTPUT},
     {"file", required_argument, NULL, CMD_SELECT_ARGS_FILE},
+    {"inline", no_argument, NULL, CMD_SELECT_ARGS_INLINE},
     {0, 0, 0, 0},
 };
 
@@ -96,14 +97,17 @@ kvcli_usage(void) {
     printf("list: List keys matching the prefix.\n");
     printf("    usage: kvcli BDEVNAME list --key KEY\n");
     printf(
-        "select: Run SQL query on the contents of KEY and write the results to FILE.\n");
+        "select: Run SQL query on the contents of KEY and write the results to FILE.\n"
+        "        With --inline, ask the device to return small results with\n"
+        "        the query (PCIe only, not NVMe-oF).\n");
     printf("    usage: kvcli BDEVNAME select --key KEY\n"
            "                      --sql SQL\n"
            "                      --file FILE\n"
            "                      [--input_format csv|json|parquet]\n"
            "                      [--output_format csv|json|parquet]\n"
            "                      [--use_csv_header_for_input]\n"
-           "                      [--use_csv_header_for_output]\n");
+           "                      [--use_csv_header_for_output]\n"
+           "                      [--inline]\n");
     printf("exists: Check if KEY exists.\n");
     printf("    usage: kvcli BDEVNAME exists --key KEY\n");
 }
@@ -312,6 +316,11 @@ kvcli_parse_args(int ch, char *arg) {
                    ((struct cmd_select_args *)cmd_args)->file);
             provided_args |= 1 << CMD_SELECT_ARGS_FILE;
             break;
+        case CMD_SELECT_ARGS_INLINE:
+            // return small results in the send buffer, needs a transport
+            // that moves data both ways in one command, i.e. PCIe
+            ((struct cmd_select_args *)cmd_args)->inline_result = true;
+            break;
         default:
             return -EINVAL;
         }
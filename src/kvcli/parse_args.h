@@ -42,6 +42,7 @@ struct cmd_select_args {
     bool use_csv_header_for_input;
     bool use_csv_header_for_output;
     char *file;
+    bool inline_result;
 };
 
 // short way to reference options of the store command
@@ -75,7 +76,8 @@ enum cmd_select_args_enum {
     CMD_SELECT_ARGS_OUTPUT_FORMAT,
     CMD_SELECT_ARGS_USE_CSV_HEADER_FOR_INPUT,
     CMD_SELECT_ARGS_USE_CSV_HEADER_FOR_OUTPUT,
-    CMD_SELECT_ARGS_FILE
+    CMD_SELECT_ARGS_FILE,
+    CMD_SELECT_ARGS_INLINE
 };
 
 // print usage
@@ -0,0 +1,201 @@
+"""Generate seeded synthetic datasets for kvcli select tests and benchmarks.
+
+Writes <name>.csv, <name>.json and/or <name>.parquet with the same rows, plus
+<name>.queryN / <name>.resultN pairs in the format test_nvme.py expects. The
+results are CSV with a header, computed while the rows are generated, so they
+stay exact at any scale. Run the same command again to get identical files.
+
+Columns:
+  id        BIGINT   0 .. rows-1, each id exactly once
+  category  VARCHAR  one of --cardinality values, cat00000, cat00001, ...
+  value     BIGINT   0 .. 999999
+  p1 .. pN  VARCHAR  --payload-columns columns of --payload-len letters (row width)
+
+Sort orders:
+  id        rows in id order, categories scattered
+  category  rows clustered by category (and by id within a category)
+  random    rows in a seeded random order of ids, categories scattered
+
+Example (about 1 GB of CSV):
+  python3 gen_dataset.py --name sf10 --scale 10 --formats csv,parquet --output-dir ./tests/gen
+  KVCLI_TEST_DIR=./tests/gen python3 test_nvme.py
+"""
+
+import argparse
+import math
+import os
+import sys
+
+import numpy as np
+import pandas as pd
+import pyarrow as pa
+import pyarrow.parquet as pq
+
+ROWS_PER_SCALE = 1000000
+MAX_KEY_LENGTH = 15
+MAX_VALUE = 1000000
+SMALL_VALUE = 1000
+FIRST_IDS = 20
+
+
+def mix64(x, seed):
+    # splitmix64 finalizer, x is a uint64 array
+    with np.errstate(over='ignore'):
+        z = x + np.uint64(seed) * np.uint64(0x9E3779B97F4A7C15)
+        z = (z ^ (z >> np.uint64(30))) * np.uint64(0xBF58476D1CE4E5B9)
+        z = (z ^ (z >> np.uint64(27))) * np.uint64(0x94D049BB133111EB)
+        return z ^ (z >> np.uint64(31))
+
+
+def row_ids(start, stop, rows, sort, seed):
+    # Ids of rows start..stop-1. For random order, use a seeded affine
+    # permutation of 0..rows-1 so the rows can be written in chunks
+    index = np.arange(start, stop, dtype=np.uint64)
+    if sort != "random" or rows < 2:
+        return index
+    step = int(mix64(np.array([rows], dtype=np.uint64), seed)[0] % np.uint64(rows)) | 1
+    while math.gcd(step, rows) != 1:
+        step += 2
+    offset = int(mix64(np.array([rows + 1], dtype=np.uint64), seed)[0] % np.uint64(rows))
+    if rows < 2 ** 32:
+        # step and index are both below 2^32, so their product fits in uint64
+        return (index * np.uint64(step) % np.uint64(rows) + np.uint64(offset)) % np.uint64(rows)
+    return np.array([(step * i + offset) % rows for i in range(start, stop)], dtype=np.uint64)
+
+
+def make_chunk(start, stop, args):
+    ids = row_ids(start, stop, args.rows, args.sort, args.seed)
+    if args.sort == "category":
+        category = (ids * np.uint64(args.cardinality)) // np.uint64(args.rows)
+    else:
+        category = mix64(ids, args.seed) % np.uint64(args.cardinality)
+    value = mix64(ids, args.seed + 1) % np.uint64(MAX_VALUE)
+
+    columns = {
+        "id": ids.astype(np.int64),
+        "category": np.char.add("cat", np.char.zfill(category.astype(np.int64).astype(str), 5)),
+        "value": value.astype(np.int64),
+    }
+    for p in range(args.payload_columns):
+        letters = np.empty((len(ids), args.payload_len), dtype=np.uint8)
+        for c in range(args.payload_len):
+            letters[:, c] = mix64(ids * np.uint64(args.payload_len) + np.uint64(c), args.seed + 2 + p) % np.uint64(26)
+        letters += ord('a')
+        columns[f"p{p + 1}"] = letters.view(f"S{args.payload_len}").ravel().astype(str)
+    return pd.DataFrame(columns), category.astype(np.int64)
+
+
+class Results:
+    # Expected results of the generated queries, updated one chunk at a time
+
+    def __init__(self, cardinality):
+        self.counts = np.zeros(cardinality, dtype=np.int64)
+        self.sums = np.zeros(cardinality, dtype=np.int64)
+        self.small_count = 0
+        self.small_min = None
+        self.small_max = None
+        self.first_rows = []
+
+    def add(self, df, category):
+        values = df["value"].to_numpy()
+        self.counts += np.bincount(category, minlength=len(self.counts))
+        # bincount would add the weights up as float64, which is only exact below 2^53
+        np.add.at(self.sums, category, values.astype(np.int64))
+
+        small = values[values < SMALL_VALUE]
+        if len(small):
+            self.small_count += len(small)
+            self.small_min = int(small.min()) if self.small_min is None else min(self.small_min, int(small.min()))
+            self.small_max = int(small.max()) if self.small_max is None else max(self.small_max, int(small.max()))
+
+        first = df[df["id"] < FIRST_IDS]
+        self.first_rows += [(int(r.id), r.category, int(r.value)) for r in first.itertuples()]
+
+    def queries(self):
+        # (query, result) pairs. Empty values are NULLs, as DuckDB writes them
+        group = "category,n,total\n" + "".join(
+            f"cat{c:05d},{n},{s}\n" for c, (n, s) in enumerate(zip(self.counts, self.sums)) if n)
+        small = "n,lo,hi\n" + f"{self.small_count}," + \
+            ("," if self.small_min is None else f"{self.small_min},{self.small_max}") + "\n"
+        first = "id,category,value\n" + "".join(f"{i},{c},{v}\n" for i, c, v in sorted(self.first_rows))
+        return [
+            ("select category, count(*) as n, sum(value) as total from s3object group by category order by category",
+             group),
+            (f"select count(*) as n, min(value) as lo, max(value) as hi from s3object where value < {SMALL_VALUE}",
+             small),
+            (f"select id, category, value from s3object where id < {FIRST_IDS} order by id",
+             first),
+        ]
+
+
+def generate(args):
+    os.makedirs(args.output_dir, exist_ok=True)
+    paths = {fmt: os.path.join(args.output_dir, f"{args.name}.{fmt}") for fmt in args.formats}
+    for path in paths.values():
+        if os.path.exists(path):
+            os.remove(path)
+
+    parquet_writer = None
+    results = Results(args.cardinality)
+    for start in range(0, args.rows, args.chunk_rows):
+        stop = min(start + args.chunk_rows, args.rows)
+        df, category = make_chunk(start, stop, args)
+        results.add(df, category)
+
+        if "csv" in paths:
+            df.to_csv(paths["csv"], mode='a', header=(start == 0), index=False)
+        if "json" in paths:
+            lines = df.to_json(orient='records', lines=True)
+            with open(paths["json"], 'a') as f:
+                f.write(lines if lines.endswith("\n") else lines + "\n")
+        if "parquet" in paths:
+            table = pa.Table.from_pandas(df, preserve_index=False)
+            if parquet_writer is None:
+                parquet_writer = pq.ParquetWriter(paths["parquet"], table.schema)
+            parquet_writer.write_table(table)
+        print(f"{stop}/{args.rows} rows", file=sys.stderr)
+
+    if parquet_writer is not None:
+        parquet_writer.close()
+
+    for n, (query, result) in enumerate(results.queries(), start=1):
+        with open(os.path.join(args.output_dir, f"{args.name}.query{n}"), 'w') as f:
+            f.write(query)
+        with open(os.path.join(args.output_dir, f"{args.name}.result{n}"), 'w') as f:
+            f.write(result)
+
+    for fmt, path in paths.items():
+        print(f"{path}: {os.path.getsize(path)} bytes")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate seeded synthetic datasets for kvcli select.")
+    parser.add_argument("--name", default="gen", help="base name of the files, used as the key")
+    parser.add_argument("--output-dir", default="./tests/gen")
+    parser.add_argument("--scale", type=float, default=1.0,
+                        help=f"scale factor, {ROWS_PER_SCALE} rows per unit (about 100 MB of CSV with the defaults)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--formats", default="csv,json,parquet", help="comma separated list of csv, json, parquet")
+    parser.add_argument("--cardinality", type=int, default=100, help="number of distinct categories")
+    parser.add_argument("--payload-columns", type=int, default=4, help="number of filler string columns")
+    parser.add_argument("--payload-len", type=int, default=16, help="length of each filler string")
+    parser.add_argument("--sort", choices=["id", "category", "random"], default="id")
+    parser.add_argument("--chunk-rows", type=int, default=ROWS_PER_SCALE, help="rows generated at a time")
+    args = parser.parse_args()
+
+    args.rows = int(args.scale * ROWS_PER_SCALE)
+    args.formats = args.formats.split(",")
+    for fmt in args.formats:
+        if fmt not in ("csv", "json", "parquet"):
+            parser.error(f"unknown format {fmt}")
+        # the file names are used as keys by test_nvme.py
+        if len(f"{args.name}.{fmt}") > MAX_KEY_LENGTH:
+            parser.error(f"{args.name}.{fmt} is longer than {MAX_KEY_LENGTH} characters")
+    if args.rows < 1 or args.cardinality < 1 or args.cardinality > 100000:
+        parser.error("need at least one row and a cardinality between 1 and 100000")
+
+    generate(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,13 +1,29 @@
 import os
 import pandas as pd
+import pyarrow as pa
+import pyarrow.parquet as pq
 import sys, subprocess
 import re
+import csv, json, statistics, time
+import filecmp
 
 BDEVNAME = os.getenv("KVCLI_BDEVNAME", "Nvme1n1")
 EXE_PATH = os.getenv("KVCLI_EXE_PATH", "./build/examples/kvcli")
 TEST_DIR = os.getenv("KVCLI_TEST_DIR", "./tests")
 TMP_DIR = os.getenv("KVCLI_TMP_DIR", "./tmp")
 
+# Performance mode (KVCLI_PERF=1) times every stage instead of only checking results.
+# Datasets are the rows of tests/cars.csv repeated KVCLI_PERF_SCALES times (cars.csv is
+# about 22 KB, so a scale of 100000 is about 2 GB), converted to JSON and PARQUET in chunks.
+PERF_MODE = os.getenv("KVCLI_PERF", "0") == "1"
+PERF_SCALES = [int(s) for s in os.getenv("KVCLI_PERF_SCALES", "1,100,10000").split(",")]
+PERF_REPEAT = int(os.getenv("KVCLI_PERF_REPEAT", "5"))
+PERF_REPORT = os.getenv("KVCLI_PERF_REPORT", "./perf_report")
+PERF_BASELINE = os.getenv("KVCLI_PERF_BASELINE")
+PERF_THRESHOLD = float(os.getenv("KVCLI_PERF_THRESHOLD", "10"))
+CSV_CHUNK_ROWS = 1000000
+PERF_QUERY = os.getenv("KVCLI_PERF_QUERY", "select Origin, count(*) as n from s3object group by Origin")
+
 num_errors = 0
 num_success = 0
 
@@ -15,15 +31,37 @@ def save_to_nvme(path):
     key = os.path.basename(path)
     subprocess.run([EXE_PATH, BDEVNAME, "store", "--key", key, "--file", path], capture_output=True)
 
-def query_nvme(key, query, data_type, output_path):
-    subprocess.run([EXE_PATH, BDEVNAME, "select", "--key", key, "--sql", query, "--input_format", data_type.lower(), "--output_format", data_type.lower(), "--file", output_path, "--use_csv_header_for_input", "--use_csv_header_for_output"], capture_output=True)
+def query_nvme(key, query, data_type, output_path, output_type=None):
+    output_type = output_type if output_type else data_type
+    subprocess.run([EXE_PATH, BDEVNAME, "select", "--key", key, "--sql", query, "--input_format", data_type.lower(), "--output_format", output_type.lower(), "--file", output_path, "--use_csv_header_for_input", "--use_csv_header_for_output"], capture_output=True)
+
+def result_type(result_path):
+    # Expected results are PARQUET (e.g. tests/data.result1) or CSV with a header (e.g. from gen_dataset.py)
+    with open(result_path, 'rb') as f:
+        return "parquet" if f.read(4) == b"PAR1" else "csv"
 
 def read_from_nvme(key, output_path):
     subprocess.run([EXE_PATH, BDEVNAME, "retrieve", "--key", key, "--file", output_path], capture_output=True)
 
-def convert_to_parquet(path, output_path):
-    df = pd.read_csv(path)
-    df.to_parquet(output_path, engine='pyarrow')
+def has_type_row(path):
+    # tests/cars.csv has a row of column types after the header, starting with the type of Car
+    with open(path, 'r') as f:
+        f.readline()
+        return f.readline().split(",")[0].strip() == "STRING"
+
+def read_csv_chunks(path, skip_type_row=False):
+    # Read in chunks so that multi-GB files do not have to fit in memory
+    return pd.read_csv(path, skiprows=[1] if skip_type_row else None, chunksize=CSV_CHUNK_ROWS)
+
+def convert_to_parquet(path, output_path, skip_type_row=False):
+    writer = None
+    for df in read_csv_chunks(path, skip_type_row):
+        table = pa.Table.from_pandas(df, schema=writer.schema if writer else None, preserve_index=False)
+        if writer is None:
+            writer = pq.ParquetWriter(output_path, table.schema)
+        writer.write_table(table)
+    if writer is not None:
+        writer.close()
 
 def list_files_on_nvme(key):
     result = subprocess.run([EXE_PATH, BDEVNAME, "list", "--key", key if key else ""], capture_output=True, text=True)
@@ -33,8 +71,8 @@ def list_files_on_nvme(key):
     return matches
 
 def files_equal(path1, path2):
-    with open(path1, 'rb') as f1, open(path2, 'rb') as f2:
-        return f1.read() == f2.read()
+    # Compares in blocks, downloads in performance mode can be several GB
+    return filecmp.cmp(path1, path2, shallow=False)
 
 def read_file(path):
     try:
@@ -65,105 +103,64 @@ def log_success(str):
     print(str)
     num_success += 1
 
-def process_files(file_directory, tmp_directory):
-    os.makedirs(tmp_directory, exist_ok=True)
-    files = os.listdir(file_directory)
-    csv_files = [f for f in files if f.endswith('.csv')]
-    uploaded_files = []
-    for csv_file in csv_files:
-        if len(csv_file) > 16:
-            print(f"length of file name {csv_file} is over 16")
+def process_format(file_directory, tmp_directory, files, extension, input_format, output_format, uploaded_files):
+    # output_format None means the format of the expected result (see result_type)
+    data_files = [f for f in files if f.endswith(extension)]
+    for data_file in data_files:
+        if len(data_file) > 16:
+            print(f"length of file name {data_file} is over 16")
             sys.exit(-1)
 
         # Upload file
-        csv_path = os.path.join(file_directory, csv_file)
-        save_to_nvme(csv_path)
-        uploaded_files.append(csv_file)
+        data_path = os.path.join(file_directory, data_file)
+        save_to_nvme(data_path)
+        uploaded_files.append(data_file)
 
         # Download file and make sure contents are correct
-        tmp_path = f"{tmp_directory}/{csv_file}"
-        read_from_nvme(csv_file, tmp_path)
-        if not files_equal(csv_path, tmp_path):
-            log_error(f"ERROR: read data for {csv_file} does not match")
+        tmp_path = f"{tmp_directory}/{data_file}"
+        read_from_nvme(data_file, tmp_path)
+        if not files_equal(data_path, tmp_path):
+            log_error(f"ERROR: read data for {data_file} does not match")
         else:
-            log_success(f"SUCCESS: read data for {csv_file} matches")
-      
+            log_success(f"SUCCESS: read data for {data_file} matches")
         os.remove(tmp_path)
 
-        # Files consists of a csv file (e.g. test.csv), files with queries to run against it (e.g. test.query1, test.query2)
+        # Files consists of a data file (e.g. test.csv), files with queries to run against it (e.g. test.query1, test.query2)
         # and expected results from the query (e.g. test.result1, test.result2)
         query_num = 1
         while True:
-            query_path = f"{file_directory}/{csv_file.replace('.csv', '')}.query{query_num}"
-            result_path = f"{file_directory}/{csv_file.replace('.csv', '')}.result{query_num}"
+            query_path = f"{file_directory}/{data_file.replace(extension, '')}.query{query_num}"
+            result_path = f"{file_directory}/{data_file.replace(extension, '')}.result{query_num}"
             query_data = read_file(query_path)
             if not query_data:
                 if query_num == 1:
-                    print(f"No queries found for {csv_file}")
+                    print(f"No queries found for {data_file}")
                 break
             if not os.path.isfile(result_path):
-                print(f"No result file for {csv_file} query {query_num}")
+                print(f"No result file for {data_file} query {query_num}")
                 query_num += 1
                 continue
-            
-            # Run query and make sure contents are correct
-            tmp_path = f"{tmp_directory}/{csv_file}"
-            query_nvme(csv_file, query_data, "CSV", tmp_path)
-            if not files_equal(result_path, tmp_path):
-                log_error(f"ERROR: query csv data for {csv_file} query {query_num} does not match")
-            else:
-                log_success(f"SUCCESS: query csv data for {csv_file} query {query_num} matches")
-            os.remove(tmp_path)
-            
-            query_num += 1
-            
-    parquet_files = [f for f in files if f.endswith('.parquet')]
-    for parquet_file in parquet_files:
-        if len(parquet_file) > 16:
-            print(f"length of file name {parquet_file} is over 16")
-            sys.exit(-1)
 
-        # Upload file
-        parquet_path = os.path.join(file_directory, parquet_file)
-        save_to_nvme(parquet_path)
-        uploaded_files.append(parquet_file)
-
-        # Download file and make sure contents are correct
-        tmp_path = f"{tmp_directory}/{parquet_file}"
-        read_from_nvme(parquet_file, tmp_path)
-        if not files_equal(parquet_path, tmp_path):
-            log_error(f"ERROR: read data for {parquet_file} does not match")
-        else:
-            log_success(f"SUCCESS: read data for {parquet_file} matches")
-        os.remove(tmp_path)
-
-        # Files consists of a csv file (e.g. test.csv), files with queries to run against it (e.g. test.query1, test.query2)
-        # and expected results from the query (e.g. test.result1, test.result2)
-        query_num = 1
-        while True:
-            query_path = f"{file_directory}/{parquet_file.replace('.parquet', '')}.query{query_num}"
-            result_path = f"{file_directory}/{parquet_file.replace('.parquet', '')}.result{query_num}"
-            query_data = read_file(query_path)
-            if not query_data:
-                if query_num == 1:
-                    print(f"No queries found for {parquet_file}")
-                break
-            if not os.path.isfile(result_path):
-                print(f"No result file for {parquet_file} query {query_num}")
-                query_num += 1
-                continue
-            
             # Run query and make sure contents are correct
-            tmp_path = f"{tmp_directory}/{parquet_file}"
-            query_nvme(parquet_file, query_data, "parquet", tmp_path)
+            tmp_path = f"{tmp_directory}/{data_file}"
+            query_nvme(data_file, query_data, input_format, tmp_path, output_format or result_type(result_path))
             if not files_equal(result_path, tmp_path):
-                log_error(f"ERROR: query parquet data for {parquet_file} query {query_num} does not match")
+                log_error(f"ERROR: query {input_format} data for {data_file} query {query_num} does not match")
             else:
-                log_success(f"SUCCESS: query parquet data for {parquet_file} query {query_num} matches")
+                log_success(f"SUCCESS: query {input_format} data for {data_file} query {query_num} matches")
             os.remove(tmp_path)
 
             query_num += 1
 
+def process_files(file_directory, tmp_directory):
+    os.makedirs(tmp_directory, exist_ok=True)
+    files = os.listdir(file_directory)
+    uploaded_files = []
+    process_format(file_directory, tmp_directory, files, '.csv', "csv", "csv", uploaded_files)
+    process_format(file_directory, tmp_directory, files, '.parquet', "parquet", None, uploaded_files)
+    # Expected results of json files are csv, since json output is not byte for byte stable
+    process_format(file_directory, tmp_directory, files, '.json', "json", "csv", uploaded_files)
+
     # Check that list files is correct
     list_files = list_files_on_nvme(None)
     if not all(elem in list_files for elem in uploaded_files):
@@ -190,4 +187,154 @@ def process_files(file_directory, tmp_directory):
         log_success("SUCCESS: Files were deleted")
     print(f"\n\nNum Errors: {num_errors}\nNum Success: {num_success}")
 
-process_files(TEST_DIR, TMP_DIR)
+def timed_run(args):
+    start = time.perf_counter()
+    result = subprocess.run([EXE_PATH, BDEVNAME] + args, capture_output=True, text=True)
+    return time.perf_counter() - start, result
+
+def make_scaled_csv(path, scale, output_path):
+    # Keep the header once and repeat the data rows. The type row of cars.csv is dropped so
+    # that the CSV, JSON and PARQUET datasets hold the same rows with the same column types
+    with open(path, 'r') as f:
+        lines = f.readlines()
+    body = "".join(lines[2:] if has_type_row(path) else lines[1:])
+    with open(output_path, 'w') as f:
+        f.write(lines[0])
+        for _ in range(scale):
+            f.write(body)
+
+def convert_to_json(path, output_path, skip_type_row=False):
+    with open(output_path, 'w') as f:
+        for df in read_csv_chunks(path, skip_type_row):
+            lines = df.to_json(orient='records', lines=True)
+            f.write(lines if lines.endswith("\n") else lines + "\n")
+
+def make_perf_datasets(file_directory, tmp_directory, scale):
+    # Returns {format: (key, path)} for one scale, keys have to stay under 16 characters
+    csv_path = f"{tmp_directory}/p{scale}.csv"
+    json_path = f"{tmp_directory}/p{scale}.json"
+    parquet_path = f"{tmp_directory}/p{scale}.pq"
+    make_scaled_csv(os.path.join(file_directory, "cars.csv"), scale, csv_path)
+    convert_to_json(csv_path, json_path)
+    convert_to_parquet(csv_path, parquet_path)
+    return {fmt: (os.path.basename(path), path) for fmt, path in
+            [("csv", csv_path), ("json", json_path), ("parquet", parquet_path)]}
+
+def record_sample(samples, scale, stage, nbytes, elapsed, result):
+    if result.returncode != 0:
+        log_error(f"ERROR: {stage} at scale {scale} failed with {result.returncode}")
+        return
+    samples.setdefault((scale, stage), {"bytes": nbytes, "seconds": []})["seconds"].append(elapsed)
+
+def run_perf_cycle(datasets, scale, samples, tmp_directory):
+    csv_key, csv_path = datasets["csv"]
+    csv_size = os.path.getsize(csv_path)
+    tmp_path = f"{tmp_directory}/p{scale}.out"
+
+    for fmt, (key, path) in datasets.items():
+        elapsed, result = timed_run(["store", "--key", key, "--file", path])
+        record_sample(samples, scale, f"upload_{fmt}", os.path.getsize(path), elapsed, result)
+
+    elapsed, result = timed_run(["retrieve", "--key", csv_key, "--file", tmp_path])
+    record_sample(samples, scale, "download_csv", csv_size, elapsed, result)
+    if result.returncode == 0 and not files_equal(csv_path, tmp_path):
+        log_error(f"ERROR: read data for {csv_key} does not match")
+    if os.path.exists(tmp_path):
+        os.remove(tmp_path)
+
+    elapsed, result = timed_run(["list", "--key", ""])
+    record_sample(samples, scale, "list", 0, elapsed, result)
+
+    elapsed, result = timed_run(["exists", "--key", csv_key])
+    record_sample(samples, scale, "exists", 0, elapsed, result)
+
+    for fmt, (key, path) in datasets.items():
+        elapsed, result = timed_run(["select", "--key", key, "--sql", PERF_QUERY, "--input_format", fmt,
+                                     "--output_format", "csv", "--file", tmp_path,
+                                     "--use_csv_header_for_input", "--use_csv_header_for_output"])
+        record_sample(samples, scale, f"select_{fmt}", os.path.getsize(path), elapsed, result)
+        if os.path.exists(tmp_path):
+            os.remove(tmp_path)
+
+    for fmt, (key, path) in datasets.items():
+        elapsed, result = timed_run(["delete", "--key", key])
+        record_sample(samples, scale, f"delete_{fmt}", 0, elapsed, result)
+
+def summarize(samples):
+    rows = []
+    for (scale, stage), sample in samples.items():
+        seconds = sorted(sample["seconds"])
+        median = statistics.median(seconds)
+        rows.append({
+            "scale": scale,
+            "stage": stage,
+            "bytes": sample["bytes"],
+            "runs": len(seconds),
+            "mean_s": statistics.mean(seconds),
+            "stdev_s": statistics.stdev(seconds) if len(seconds) > 1 else 0.0,
+            "median_s": median,
+            "min_s": seconds[0],
+            "p95_s": statistics.quantiles(seconds, n=20, method='inclusive')[18] if len(seconds) > 1 else seconds[0],
+            "mb_per_s": sample["bytes"] / median / 1e6 if sample["bytes"] and median > 0 else None,
+            "seconds": sample["seconds"],
+        })
+    return rows
+
+def write_report(rows, report_path):
+    report = {
+        "bdev": BDEVNAME,
+        "repeat": PERF_REPEAT,
+        "query": PERF_QUERY,
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "results": rows,
+    }
+    with open(f"{report_path}.json", 'w') as f:
+        json.dump(report, f, indent=2)
+    with open(f"{report_path}.csv", 'w', newline='') as f:
+        fields = [k for k in rows[0].keys() if k != "seconds"] if rows else []
+        writer = csv.DictWriter(f, fieldnames=fields, extrasaction='ignore')
+        writer.writeheader()
+        writer.writerows(rows)
+    print(f"Wrote {report_path}.json and {report_path}.csv")
+
+def compare_to_baseline(rows, baseline_path, threshold):
+    # Flag every stage whose median time grew by more than threshold percent
+    with open(baseline_path, 'r') as f:
+        baseline = {(r["scale"], r["stage"]): r for r in json.load(f)["results"]}
+    for row in rows:
+        base = baseline.get((row["scale"], row["stage"]))
+        if base is None:
+            print(f"No baseline for {row['stage']} at scale {row['scale']}")
+            continue
+        change = (row["median_s"] - base["median_s"]) / base["median_s"] * 100
+        message = f"{row['stage']} at scale {row['scale']}: {base['median_s']:.4f}s -> {row['median_s']:.4f}s ({change:+.1f}%)"
+        if change > threshold:
+            log_error(f"REGRESSION: {message}")
+        else:
+            log_success(f"OK: {message}")
+
+def run_perf(file_directory, tmp_directory):
+    os.makedirs(tmp_directory, exist_ok=True)
+    samples = {}
+    for scale in PERF_SCALES:
+        datasets = make_perf_datasets(file_directory, tmp_directory, scale)
+        print(f"Scale {scale}: " + ", ".join(f"{fmt} {os.path.getsize(path)} bytes" for fmt, (_, path) in datasets.items()))
+        for _ in range(PERF_REPEAT):
+            run_perf_cycle(datasets, scale, samples, tmp_directory)
+        for _, path in datasets.values():
+            os.remove(path)
+
+    rows = summarize(samples)
+    for row in rows:
+        print(f"{row['stage']:>16} scale {row['scale']:>8}: median {row['median_s']:.4f}s, p95 {row['p95_s']:.4f}s")
+    write_report(rows, PERF_REPORT)
+
+    if PERF_BASELINE:
+        compare_to_baseline(rows, PERF_BASELINE, PERF_THRESHOLD)
+    print(f"\n\nNum Errors: {num_errors}\nNum Success: {num_success}")
+    sys.exit(1 if num_errors else 0)
+
+if PERF_MODE:
+    run_perf(TEST_DIR, TMP_DIR)
+else:
+    process_files(TEST_DIR, TMP_DIR)